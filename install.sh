@@ -1,7 +1,7 @@
 # Must be ran as root
 
 # http://www.pcre.org/
-sudo apt-get -y install libtool m4 automake
+sudo apt-get -y install libtool m4 automake libssl-dev
 
 wget https://ftp.pcre.org/pub/pcre/pcre2-10.32.tar.gz
 
@@ -32,4 +32,4 @@ sudo make install
 sudo ldconfig
 
 ### COMPILE WITH: ###
-# gcc webScraper.c -lpcre2-8 -lgumbo
\ No newline at end of file
+# gcc webScraper.c -lpcre2-8 -lgumbo -lssl -lcrypto -lpthread
\ No newline at end of file
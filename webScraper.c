@@ -4,17 +4,52 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <time.h>
 #include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
 
 #include <netdb.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/time.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 
 #include <gumbo.h>
 #include <pcre2.h>
-
+#include <openssl/ssl.h>
+
+// Upper bound on the number of idle keep-alive connections held open across all hosts
+#define MAX_IDLE_CONNECTIONS 16
+// Idle connections older than this are assumed to have been dropped by the server
+#define CONNECTION_IDLE_TIMEOUT_SECONDS 5
+// Connecting, and every single send or receive, fails after this long so a stalled server cannot hang a thread
+#define SOCKET_TIMEOUT_SECONDS 10
+// Responses whose headers do not end within this many bytes are rejected
+#define MAX_HEADER_BYTES 65536
+// Only this much of a page is read and searched for links
+#define MAX_PAGE_BYTES 10485760
+// Product token looked up in the User-agent lines of robots.txt
+#define ROBOTS_USER_AGENT "CThreadedWebSpider"
+// Sent as the User-Agent header, so servers see the same agent whose robots.txt rules we follow
+#define SPIDER_USER_AGENT ROBOTS_USER_AGENT "/1.0"
+// How long a fetched robots.txt is trusted before it is fetched again
+#define ROBOTS_CACHE_TTL_SECONDS 86400
+// How soon to try again when robots.txt could not be fetched (server error or unreachable)
+#define ROBOTS_RETRY_SECONDS 60
+// Redirects followed when fetching robots.txt, RFC 9309 asks for at least five
+#define ROBOTS_MAX_REDIRECTS 5
+// Only this much of a robots.txt is parsed, RFC 9309 asks for at least 500 KiB
+#define ROBOTS_MAX_BYTES 512000
+// Longer Allow/Disallow patterns are ignored
+#define ROBOTS_MAX_RULE_LENGTH 512
+// Longer paths are never crawled, which bounds the cost of a robots.txt check
+#define ROBOTS_MAX_PATH_LENGTH 2048
+// Larger Crawl-delay values are lowered to this, so a hostile robots.txt cannot stall the crawl
+#define ROBOTS_MAX_CRAWL_DELAY_SECONDS 60
 
 typedef struct gumboStackNode
 {
@@ -29,18 +64,148 @@ typedef struct urlStackNode
     int urlLength;
 } urlStackNode;
 
+typedef struct pathSetSlot
+{
+    char *path;
+    unsigned long hash;
+} pathSetSlot;
+
+// Open addressing hash set of paths, capacity is always a power of two
+typedef struct PathSet
+{
+    pathSetSlot *slots;
+    int capacity;
+    int count;
+} PathSet;
+
 typedef struct ScrapingInfo
 {
     char *baseURL;
     char *pathURL;
     char *originalURL;
     char *IP;
+    int port;
+    int useTLS;
+    // The host's robots.txt cache entry, looked up once and then read without robotsCacheMutex
+    struct robotsCacheNode *robots;
 } ScrapingInfo;
 
+typedef struct HTTPConnection
+{
+    int socketFileDesc;
+    // NULL for plain HTTP connections
+    SSL *ssl;
+    // "scheme://host:port", identifies which connections and TLS sessions are interchangeable
+    char *poolKey;
+    struct timespec lastUsed;
+} HTTPConnection;
+
+typedef struct connectionPoolNode
+{
+    struct connectionPoolNode *next;
+    HTTPConnection *connection;
+} connectionPoolNode;
+
+typedef struct tlsSessionCacheNode
+{
+    struct tlsSessionCacheNode *next;
+    char *poolKey;
+    SSL_SESSION *session;
+} tlsSessionCacheNode;
+
+typedef struct ConnectionStatistics
+{
+    long fullHandshakes;
+    long resumedHandshakes;
+    long reusedConnections;
+    double fullHandshakeSeconds;
+    double resumedHandshakeSeconds;
+} ConnectionStatistics;
+
+typedef struct robotsTrieNode
+{
+    // Indexes into RobotsMatcher.nodes, -1 when there is none
+    int firstChild;
+    int nextSibling;
+    // Length of the pattern from the root up to this node
+    int depth;
+    // Path character consumed by this node, '*' matches any run of characters
+    unsigned char label;
+    // 1 for Allow, -1 for Disallow, 0 if no rule ends here; endRule is for rules anchored with '$'
+    signed char rule;
+    signed char endRule;
+} robotsTrieNode;
+
+// Allow/Disallow rules compiled into a prefix trie stored in one flat array
+typedef struct RobotsMatcher
+{
+    robotsTrieNode *nodes;
+    int nodeCount;
+    int nodeCapacity;
+} RobotsMatcher;
+
+// Per thread scratch space for matchRobotsRules: the live trie nodes before and after the current
+// path character, and the step in which each node was last made live
+typedef struct RobotsMatchScratch
+{
+    int *liveNodes;
+    int *nextNodes;
+    unsigned long *nodeSteps;
+    unsigned long step;
+    int capacity;
+} RobotsMatchScratch;
+
+typedef struct robotsCacheNode
+{
+    struct robotsCacheNode *next;
+    // Same "scheme://host:port" format as HTTPConnection.poolKey
+    char *hostKey;
+    // Guarded by matcherLock so a refresh can swap the rules while other threads are matching
+    RobotsMatcher matcher;
+    pthread_rwlock_t matcherLock;
+    // CLOCK_MONOTONIC nanoseconds after which the rules are refetched, 0 until the first fetch;
+    // written under robotsCacheMutex but read atomically without it on the robotsAllowed fast path
+    long expiresAt;
+    // Guarded by robotsCacheMutex
+    int ready;
+    int fetching;
+    pthread_cond_t fetchDone;
+    // Guarded by crawlSlotMutex
+    pthread_mutex_t crawlSlotMutex;
+    double crawlDelaySeconds;
+    int crawlSlotsStarted;
+    struct timespec nextCrawlSlot;
+} robotsCacheNode;
+
 ScrapingInfo *parsedInfo;
 urlStackNode *TotalUrlStack;
+// Every path ever added to TotalUrlStack, so pages are only crawled once
+PathSet queuedPaths;
+
+// Optional CA bundle used instead of the system trust store (e.g. a self-signed test CA)
+char *tlsCAFile;
+SSL_CTX *tlsContext;
+pthread_once_t tlsContextOnce = PTHREAD_ONCE_INIT;
+
+tlsSessionCacheNode *tlsSessionCache;
+connectionPoolNode *idleConnections;
+int idleConnectionCount;
+ConnectionStatistics connectionStatistics;
+robotsCacheNode *robotsCache;
+
+// Each thread's RobotsMatchScratch, also stored under robotsScratchKey so the key's destructor frees
+// it when the thread exits
+__thread RobotsMatchScratch *robotsScratch;
+pthread_key_t robotsScratchKey;
+pthread_once_t robotsScratchKeyOnce = PTHREAD_ONCE_INIT;
 
 pthread_mutex_t urlAddMutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_mutex_t tlsSessionCacheMutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_mutex_t connectionPoolMutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_mutex_t connectionStatisticsMutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_mutex_t robotsCacheMutex = PTHREAD_MUTEX_INITIALIZER;
+// gethostbyname (used by getScrapingInfo) is not thread safe
+pthread_mutex_t hostLookupMutex = PTHREAD_MUTEX_INITIALIZER;
 
 void pushGumboStackNode(gumboStackNode **head, GumboNode *node)
 {
@@ -225,7 +390,8 @@ void freeScrapingInfo(ScrapingInfo *scrapingInfo)
 
 ScrapingInfo *getScrapingInfo(char *originalURL, int *errorCode)
 {
-    // Current raw regex pattern: "(?:.*?\/\/)?((?:www\.)?.*?(?:\.\w+)+)(\/.*)?"
+    // Current raw regex pattern: "(?:(.*?):?\/\/)?((?:www\.)?.*?(?:\.\w+)+)(?::(\d+))?(\/.*)?"
+    // Capture groups: 1 = scheme, 2 = host, 3 = port, 4 = path
 
     // Uninitialized compiled regex variable
     pcre2_code *re;
@@ -233,7 +399,7 @@ ScrapingInfo *getScrapingInfo(char *originalURL, int *errorCode)
     PCRE2_SIZE erroroffset;
 
     // PCRE2 String Pointer Type
-    PCRE2_SPTR name_table, subject = (PCRE2_SPTR)originalURL, pattern = (PCRE2_SPTR) "(?:.*?\\/\\/)?((?:www\\.)?.*?(?:\\.\\w+)+)(\\/.*)?";
+    PCRE2_SPTR name_table, subject = (PCRE2_SPTR)originalURL, pattern = (PCRE2_SPTR) "(?:(.*?):?\\/\\/)?((?:www\\.)?.*?(?:\\.\\w+)+)(?::(\\d+))?(\\/.*)?";
 
     // Dummy error code catcher, we need it to call the function, won't use it later
     int errorNumber;
@@ -284,42 +450,55 @@ ScrapingInfo *getScrapingInfo(char *originalURL, int *errorCode)
     // Allocate memory for the ScrapingInfo struct that will be returned
     ScrapingInfo *parsedInfo = (ScrapingInfo *)malloc(sizeof(ScrapingInfo));
 
-    // String lengths for the original string, base URL match, and path portion of the URL match
-    size_t stringLengths[3];
+    parsedInfo->robots = NULL;
+
+    // String lengths for the original string, scheme, base URL, port, and path portion of the URL match,
+    // groups which did not take part in the match are left as 0
+    size_t stringLengths[5] = {0};
 
     // Create an offset vector from the match
     PCRE2_SIZE *matchOffsetArray = pcre2_get_ovector_pointer(matchData);
 
     // Populate our string lengths so we can allocate memory properly
     for (int i = 0; i < matchResult; i++)
-        stringLengths[i] = matchOffsetArray[2 * i + 1] - matchOffsetArray[2 * i];
+        if (matchOffsetArray[2 * i] != PCRE2_UNSET)
+            stringLengths[i] = matchOffsetArray[2 * i + 1] - matchOffsetArray[2 * i];
 
     // Allocate memory for the fields of the returned ScrapingInfo structure
     parsedInfo->originalURL = (char *)malloc(sizeof(char) * stringLengths[0] + 1);
-    parsedInfo->baseURL = (char *)malloc(sizeof(char) * stringLengths[1] + 1);
+    parsedInfo->baseURL = (char *)malloc(sizeof(char) * stringLengths[2] + 1);
 
     // Copy the matches to their respective fields of the ScrapingInfo structure
     strncpy(parsedInfo->originalURL, subject + matchOffsetArray[0], stringLengths[0]);
-    strncpy(parsedInfo->baseURL, subject + matchOffsetArray[2], stringLengths[1]);
+    strncpy(parsedInfo->baseURL, subject + matchOffsetArray[4], stringLengths[2]);
+
+    // Only an explicit "https" scheme switches to TLS, anything else is treated as plain HTTP
+    parsedInfo->useTLS = stringLengths[1] == 5 && strncasecmp((char *)subject + matchOffsetArray[2], "https", 5) == 0;
+
+    // The port match is followed by either the path or the end of the string, so strtol stops in the right place
+    if (stringLengths[3])
+        parsedInfo->port = (int)strtol((char *)subject + matchOffsetArray[6], NULL, 10);
+    else
+        parsedInfo->port = parsedInfo->useTLS ? 443 : 80;
 
     // Handles the case where there is no path at the end of the URL
-    if (matchResult == 3)
+    if (stringLengths[4])
     {
-        parsedInfo->pathURL = (char *)malloc(sizeof(char) * stringLengths[2] + 1);
-        strncpy(parsedInfo->pathURL, subject + matchOffsetArray[4], stringLengths[2]);
+        parsedInfo->pathURL = (char *)malloc(sizeof(char) * stringLengths[4] + 1);
+        strncpy(parsedInfo->pathURL, subject + matchOffsetArray[8], stringLengths[4]);
     }
     else
     {
         // sizeof(char) * 2 needed for '/' + NULL terminator
         parsedInfo->pathURL = (char *)malloc(sizeof(char) * 2);
         parsedInfo->pathURL[0] = '/';
-        stringLengths[2] = 1;
+        stringLengths[4] = 1;
     }
 
     // Set the NULL terminators for each of our fields
     parsedInfo->originalURL[stringLengths[0]] = 0;
-    parsedInfo->baseURL[stringLengths[1]] = 0;
-    parsedInfo->pathURL[stringLengths[2]] = 0;
+    parsedInfo->baseURL[stringLengths[2]] = 0;
+    parsedInfo->pathURL[stringLengths[4]] = 0;
 
     // Release the memory used for the match
     pcre2_match_data_free(matchData);
@@ -345,18 +524,208 @@ ScrapingInfo *getScrapingInfo(char *originalURL, int *errorCode)
 
     // To convert an IP address to its string representation
     // parsedInfo->IP = inet_ntoa(*((struct in_addr *)hostEntry->h_addr_list[0]));
-    int ipLength = strlen(hostEntry->h_addr_list[0]);
 
-    parsedInfo->IP = malloc(sizeof(char) * (ipLength + 1));
+    // The address is raw network byte order rather than a string and may contain 0 bytes
+    // (e.g. 127.0.0.1), so copy exactly h_length bytes instead of using strlen
+    parsedInfo->IP = malloc(sizeof(char) * hostEntry->h_length);
 
-    // +1 to include space for the full IP string and the NULL terminator
-    strncpy(parsedInfo->IP, hostEntry->h_addr_list[0], ipLength);
-    parsedInfo->IP[ipLength] = 0;
+    memcpy(parsedInfo->IP, hostEntry->h_addr_list[0], hostEntry->h_length);
 
     return parsedInfo;
 }
 
-char *makeHTTPRequest(char *IP, char *baseURL, char *pathURL, int bufferSize, int *errorCode)
+long monotonicNanoseconds()
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec * 1000000000L + now.tv_nsec;
+}
+
+double secondsSince(struct timespec *start)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+// Called by OpenSSL whenever the server hands out a new session (for TLS 1.3 this happens after the
+// handshake, while the response is being read), returning 1 to signal that we keep the reference
+int storeTLSSession(SSL *ssl, SSL_SESSION *session)
+{
+    HTTPConnection *connection = SSL_get_app_data(ssl);
+
+    pthread_mutex_lock(&tlsSessionCacheMutex);
+
+    tlsSessionCacheNode *node = tlsSessionCache;
+
+    while (node && strcmp(node->poolKey, connection->poolKey))
+        node = node->next;
+
+    if (node)
+    {
+        // Only the most recent ticket for a host is kept
+        SSL_SESSION_free(node->session);
+    }
+    else
+    {
+        node = malloc(sizeof(tlsSessionCacheNode));
+
+        node->poolKey = strdup(connection->poolKey);
+        node->next = tlsSessionCache;
+
+        tlsSessionCache = node;
+    }
+
+    node->session = session;
+
+    pthread_mutex_unlock(&tlsSessionCacheMutex);
+
+    return 1;
+}
+
+// Returns a new reference to the cached session for the host, or NULL if there is nothing to resume
+SSL_SESSION *getTLSSession(char *poolKey)
+{
+    SSL_SESSION *session = NULL;
+
+    pthread_mutex_lock(&tlsSessionCacheMutex);
+
+    for (tlsSessionCacheNode *node = tlsSessionCache; node; node = node->next)
+    {
+        if (!strcmp(node->poolKey, poolKey))
+        {
+            if (SSL_SESSION_is_resumable(node->session))
+            {
+                session = node->session;
+                SSL_SESSION_up_ref(session);
+            }
+
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&tlsSessionCacheMutex);
+
+    return session;
+}
+
+void initializeTLSContext(void)
+{
+    SSL_CTX *context = SSL_CTX_new(TLS_client_method());
+
+    if (!context)
+        return;
+
+    SSL_CTX_set_min_proto_version(context, TLS1_2_VERSION);
+    SSL_CTX_set_verify(context, SSL_VERIFY_PEER, NULL);
+
+#ifdef SSL_OP_IGNORE_UNEXPECTED_EOF
+    // Plenty of servers close the socket without a close_notify after a "Connection: close" response
+    SSL_CTX_set_options(context, SSL_OP_IGNORE_UNEXPECTED_EOF);
+#endif
+
+    int trustLoaded = tlsCAFile ? SSL_CTX_load_verify_locations(context, tlsCAFile, NULL)
+                                : SSL_CTX_set_default_verify_paths(context);
+
+    if (!trustLoaded)
+    {
+        SSL_CTX_free(context);
+
+        return;
+    }
+
+    // Sessions are kept in our own cache keyed by host, OpenSSL's internal cache is server oriented
+    SSL_CTX_set_session_cache_mode(context, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(context, storeTLSSession);
+
+    tlsContext = context;
+}
+
+void closeConnection(HTTPConnection *connection)
+{
+    if (connection->ssl)
+    {
+        // Send close_notify without waiting for the server's reply
+        SSL_shutdown(connection->ssl);
+        SSL_free(connection->ssl);
+    }
+
+    close(connection->socketFileDesc);
+
+    free(connection->poolKey);
+    free(connection);
+}
+
+// Takes an idle keep-alive connection for the host out of the pool, or returns NULL if there is none
+HTTPConnection *takeIdleConnection(char *poolKey)
+{
+    HTTPConnection *connection = NULL;
+    char peekByte;
+
+    pthread_mutex_lock(&connectionPoolMutex);
+
+    connectionPoolNode **link = &idleConnections;
+
+    while (*link && !connection)
+    {
+        connectionPoolNode *node = *link;
+
+        if (strcmp(node->connection->poolKey, poolKey))
+        {
+            link = &node->next;
+
+            continue;
+        }
+
+        *link = node->next;
+        idleConnectionCount--;
+
+        // A zero length peek means the server has already closed its end
+        if (secondsSince(&node->connection->lastUsed) > CONNECTION_IDLE_TIMEOUT_SECONDS ||
+            recv(node->connection->socketFileDesc, &peekByte, 1, MSG_PEEK | MSG_DONTWAIT) == 0)
+            closeConnection(node->connection);
+        else
+            connection = node->connection;
+
+        free(node);
+    }
+
+    pthread_mutex_unlock(&connectionPoolMutex);
+
+    return connection;
+}
+
+// Hands a connection whose last response was fully read back to the pool for reuse
+void releaseConnection(HTTPConnection *connection)
+{
+    clock_gettime(CLOCK_MONOTONIC, &connection->lastUsed);
+
+    pthread_mutex_lock(&connectionPoolMutex);
+
+    if (idleConnectionCount < MAX_IDLE_CONNECTIONS)
+    {
+        connectionPoolNode *node = malloc(sizeof(connectionPoolNode));
+
+        node->connection = connection;
+        node->next = idleConnections;
+
+        idleConnections = node;
+        idleConnectionCount++;
+
+        connection = NULL;
+    }
+
+    pthread_mutex_unlock(&connectionPoolMutex);
+
+    if (connection)
+        closeConnection(connection);
+}
+
+HTTPConnection *openConnection(ScrapingInfo *scrapingInfo, char *poolKey, int *errorCode)
 {
     int socketFileDesc = socket(AF_INET, SOCK_STREAM, 0);
 
@@ -366,12 +735,15 @@ char *makeHTTPRequest(char *IP, char *baseURL, char *pathURL, int bufferSize, in
         // Indicate failure to create a socket with error code 1
         *errorCode = 1;
 
-        // Perform cleanup
-        close(socketFileDesc);
-
         return NULL;
     }
 
+    // On Linux the send timeout also bounds connect(); a timed out call fails like any other socket error
+    struct timeval socketTimeout = {SOCKET_TIMEOUT_SECONDS, 0};
+
+    setsockopt(socketFileDesc, SOL_SOCKET, SO_RCVTIMEO, &socketTimeout, sizeof(socketTimeout));
+    setsockopt(socketFileDesc, SOL_SOCKET, SO_SNDTIMEO, &socketTimeout, sizeof(socketTimeout));
+
     // serverAddress is the struct representing the server to connect to
     struct sockaddr_in serv_addr;
 
@@ -382,12 +754,12 @@ char *makeHTTPRequest(char *IP, char *baseURL, char *pathURL, int bufferSize, in
     serv_addr.sin_family = AF_INET;
 
     // Copy IP to server address field
-    bcopy((char *)IP,
+    bcopy((char *)scrapingInfo->IP,
           (char *)&serv_addr.sin_addr.s_addr,
-          strlen(IP));
+          sizeof(serv_addr.sin_addr.s_addr));
 
     // Converts port to network byte order
-    serv_addr.sin_port = htons(80);
+    serv_addr.sin_port = htons(scrapingInfo->port);
 
     // Try to connect to server
     int socketStatus = connect(socketFileDesc, (struct sockaddr *)&serv_addr, sizeof(serv_addr));
@@ -404,255 +776,1431 @@ char *makeHTTPRequest(char *IP, char *baseURL, char *pathURL, int bufferSize, in
         return NULL;
     }
 
-    char *requestFormatString = "GET %s HTTP/1.1\r\nHost: %s\r\nUser-Agent: Mozilla/5.0 (Macintosh; Intel Mac OS X 10_9_3) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/35.0.1916.47 Safari/537.36\r\n\r\n";
-
-    // Calculate length needed for the request body string,
-    // subtract 4 to account for the space taken up by format specifiers
-    int totalLength = strlen(requestFormatString) + strlen(baseURL) + strlen(pathURL) - 4 + 1;
-
-    // Create string to hold request body, add 1 for the NULL terminator
-    char requestString[totalLength];
-
-    // Create request body
-    snprintf(requestString, totalLength, requestFormatString, pathURL, baseURL);
+    HTTPConnection *connection = malloc(sizeof(HTTPConnection));
 
-    // Create a buffer for holding the read data + NULL terminator
-    char streamBuffer[bufferSize + 1];
+    connection->socketFileDesc = socketFileDesc;
+    connection->ssl = NULL;
+    connection->poolKey = strdup(poolKey);
 
-    // Create buffer for accumulating read in data to find the end of the headers
-    // and beginning of response body, and create buffer to hold the response body itself
-    char *responseHeadersBuffer = NULL, *responseBodyBuffer = NULL;
+    if (!scrapingInfo->useTLS)
+        return connection;
 
-    int numberOfBytesWritten = write(socketFileDesc, requestString, strlen(requestString));
+    pthread_once(&tlsContextOnce, initializeTLSContext);
 
-    // If the returned number of bytes written is less than 0 an error occured
-    if (numberOfBytesWritten < 0)
+    if (!tlsContext || !(connection->ssl = SSL_new(tlsContext)))
     {
-        // Indicate connection write failure with error code 3
-        *errorCode = 3;
+        // Indicate failure to set up TLS (bad CA file, out of memory) with error code 6
+        *errorCode = 6;
 
-        close(socketFileDesc);
+        closeConnection(connection);
 
         return NULL;
     }
 
-    int responseBodyBufferLength = 0, preamble = 1, preambleBufferLength = 0, statusCode = 0;
+    SSL_set_fd(connection->ssl, socketFileDesc);
+    SSL_set_app_data(connection->ssl, connection);
 
-    // int numberOfBytesRead = read(socketFileDesc, streamBuffer, bufferSize);
-    int numberOfBytesRead = recv(socketFileDesc, streamBuffer, bufferSize, 0);
+    struct in_addr literalAddress;
 
-    do
+    // IP literals are checked against the certificate's IP SANs and must not be sent as SNI,
+    // hostnames get SNI and certificate hostname verification
+    if (inet_pton(AF_INET, scrapingInfo->baseURL, &literalAddress) == 1)
     {
-        if (numberOfBytesRead < 0)
-        {
-            // Indicate connection read failure with error code 4
-            *errorCode = 4;
+        X509_VERIFY_PARAM_set1_ip_asc(SSL_get0_param(connection->ssl), scrapingInfo->baseURL);
+    }
+    else
+    {
+        SSL_set_tlsext_host_name(connection->ssl, scrapingInfo->baseURL);
+        SSL_set1_host(connection->ssl, scrapingInfo->baseURL);
+    }
 
-            // Perform cleanup
-            if (responseBodyBuffer)
-                free(responseBodyBuffer);
+    SSL_SESSION *cachedSession = getTLSSession(poolKey);
 
-            if (responseHeadersBuffer)
-                free(responseHeadersBuffer);
+    if (cachedSession)
+    {
+        SSL_set_session(connection->ssl, cachedSession);
+        SSL_SESSION_free(cachedSession);
+    }
 
-            close(socketFileDesc);
+    struct timespec handshakeStart;
 
-            return NULL;
-        }
+    clock_gettime(CLOCK_MONOTONIC, &handshakeStart);
 
-        streamBuffer[numberOfBytesRead] = 0;
+    if (SSL_connect(connection->ssl) != 1)
+    {
+        // Indicate a failed TLS handshake (including certificate verification) with error code 7
+        *errorCode = 7;
 
-        if (preamble)
-        {
-            if (responseHeadersBuffer == NULL)
-            {
-                preambleBufferLength = numberOfBytesRead;
+        closeConnection(connection);
 
-                // +1 to account for NULL terminator
-                responseHeadersBuffer = (char *)malloc(sizeof(char) * (preambleBufferLength + 1));
+        return NULL;
+    }
 
-                strncpy(responseHeadersBuffer, streamBuffer, preambleBufferLength);
-                responseHeadersBuffer[preambleBufferLength] = 0;
-            }
-            else
-            {
-                preambleBufferLength += numberOfBytesRead;
+    double handshakeSeconds = secondsSince(&handshakeStart);
 
-                responseHeadersBuffer = realloc(responseHeadersBuffer, sizeof(char) * (preambleBufferLength + 1));
+    pthread_mutex_lock(&connectionStatisticsMutex);
 
-                strncat(responseHeadersBuffer, streamBuffer, numberOfBytesRead);
-                responseHeadersBuffer[preambleBufferLength] = 0;
-            }
+    if (SSL_session_reused(connection->ssl))
+    {
+        connectionStatistics.resumedHandshakes++;
+        connectionStatistics.resumedHandshakeSeconds += handshakeSeconds;
+    }
+    else
+    {
+        connectionStatistics.fullHandshakes++;
+        connectionStatistics.fullHandshakeSeconds += handshakeSeconds;
+    }
 
-            /* Stack Smashing not occuring in here; check responseBodyBuffer */
+    pthread_mutex_unlock(&connectionStatisticsMutex);
 
-            // Points to the memory location where the beginning of the substring "\r\n\r\n" occurs
-            char *headerEndPointer = strstr(responseHeadersBuffer, "\r\n\r\n");
+    return connection;
+}
 
-            // headerEndPointer will be NULL if the substring cannot be found
-            if (headerEndPointer)
-            {
-                // Some pointer arithmatic with the found pointer to get the starting index of the substring
-                int headerEndingLength = headerEndPointer - responseHeadersBuffer;
+// Returns the number of bytes written, or -1 on failure
+int connectionWrite(HTTPConnection *connection, char *buffer, int length)
+{
+    if (connection->ssl)
+        return SSL_write(connection->ssl, buffer, length) > 0 ? length : -1;
 
-                // Need to subtract 4 more to headerEndingLength account for the '\r\n\r\n' substring
-                responseBodyBufferLength = (preambleBufferLength - headerEndingLength - 4);
+    return write(connection->socketFileDesc, buffer, length);
+}
 
-                // +1 to account for NULL terminator
-                responseBodyBuffer = (char *)malloc(sizeof(char) * (responseBodyBufferLength + 1));
+// Returns the number of bytes read, 0 once the server has closed the connection, or -1 on failure
+int connectionRead(HTTPConnection *connection, char *buffer, int length)
+{
+    if (!connection->ssl)
+        return recv(connection->socketFileDesc, buffer, length, 0);
 
-                // 4 to skip the '\r\n\r\n' substring
-                strncpy(responseBodyBuffer, (char *)headerEndPointer + 4, responseBodyBufferLength);
+    int numberOfBytesRead = SSL_read(connection->ssl, buffer, length);
 
-                responseBodyBuffer[responseBodyBufferLength] = 0;
+    if (numberOfBytesRead > 0)
+        return numberOfBytesRead;
 
-                //printf("%d %d %d %d\n", strlen(headerEndPointer + 4), responseBodyBufferLength, strlen(responseBodyBuffer), numberOfBytesRead);
+    return SSL_get_error(connection->ssl, numberOfBytesRead) == SSL_ERROR_ZERO_RETURN ? 0 : -1;
+}
 
-                preamble = 0;
-            }
+// Finds the value of a response header (case insensitive), returns NULL if the header is not present
+char *findHeaderValue(char *headers, char *name)
+{
+    int nameLength = strlen(name);
 
-            // Status code should be found on first line, function will assume failure if  (buffer should be set to a reasonable length)
-            if (!statusCode)
-            {
-                // Attempt to parse status code
-                int charactersWritten = sscanf(responseHeadersBuffer, "%*s %d", &statusCode);
-
-                // charactersWritten < 0 indicates failure to parse status code, possible a malformed response;
-                // however, the failure is fine in the case that the buffer is small and not enough of the response
-                // has been read to get the status code
-                if (charactersWritten < 0)
-                    statusCode = 0;
-            }
-        }
-        else
+    // Skip the status line
+    char *line = strstr(headers, "\r\n");
+
+    while (line && line[2] != '\r')
+    {
+        line += 2;
+
+        if (!strncasecmp(line, name, nameLength) && line[nameLength] == ':')
         {
-            responseBodyBufferLength += numberOfBytesRead;
+            char *value = line + nameLength + 1;
 
-            responseBodyBuffer = (char *)realloc(responseBodyBuffer, sizeof(char) * (responseBodyBufferLength + 1));
-            strncat(responseBodyBuffer, streamBuffer, numberOfBytesRead);
+            while (*value == ' ' || *value == '\t')
+                value++;
 
-            responseBodyBuffer[responseBodyBufferLength] = 0;
+            return value;
         }
 
-        if (statusCode && (statusCode < 200 || statusCode > 299))
-        {
-            // Indicate bad response (non-200 status code) with error code 5
-            *errorCode = 5;
+        line = strstr(line, "\r\n");
+    }
 
-            // int l1 = strlen(responseBodyBuffer), l2 = strlen(responseHeadersBuffer), l3 = strlen(streamBuffer);
+    return NULL;
+}
 
-            // puts(responseBodyBuffer);
+// Decodes as many complete chunks of a chunked body as are available, in place, advancing parseOffset
+// past the consumed chunks; returns 1 once the terminating chunk has been read, 0 if more data is
+// needed, and -1 if the body is malformed
+int decodeChunks(char *buffer, int bufferLength, int *parseOffset, int *decodedLength)
+{
+    while (1)
+    {
+        int lineEnd = *parseOffset;
 
-            // printf("%d %d %ld, %d %d %ld, %d %d %ld\n", l1, responseBodyBufferLength, (&responseBodyBuffer)[1] - responseBodyBuffer, l2, preambleBufferLength, (&responseHeadersBuffer)[1] - responseHeadersBuffer, l3, numberOfBytesRead, (&streamBuffer)[1] - streamBuffer);
+        while (lineEnd + 1 < bufferLength && !(buffer[lineEnd] == '\r' && buffer[lineEnd + 1] == '\n'))
+            lineEnd++;
 
-            // Perform cleanup
-            if (responseBodyBuffer)
-                free(responseBodyBuffer);
+        if (lineEnd + 1 >= bufferLength)
+            return 0;
 
-            if (responseHeadersBuffer)
-                free(responseHeadersBuffer);
+        char *sizeEnd;
+        long chunkSize = strtol(buffer + *parseOffset, &sizeEnd, 16);
 
-            close(socketFileDesc);
+        if (sizeEnd == buffer + *parseOffset || chunkSize < 0)
+            return -1;
 
-            return NULL;
+        if (chunkSize == 0)
+        {
+            // The last chunk is followed by optional trailers and an empty line
+            for (int i = lineEnd; i + 3 < bufferLength; i++)
+                if (!strncmp(buffer + i, "\r\n\r\n", 4))
+                    return 1;
+
+            return 0;
         }
-        // } while ((numberOfBytesRead = read(socketFileDesc, streamBuffer, bufferSize)));
-    } while ((numberOfBytesRead = recv(socketFileDesc, streamBuffer, bufferSize, 0)));
 
-    if (streamBuffer)
-        free(responseHeadersBuffer);
+        int dataStart = lineEnd + 2;
 
-    close(socketFileDesc);
+        // Wait for the whole chunk plus its trailing CRLF
+        if (dataStart + chunkSize + 2 > bufferLength)
+            return 0;
 
-    *errorCode = 0;
+        // The decoded data always trails the parse offset, so this never overwrites unparsed input
+        memmove(buffer + *decodedLength, buffer + dataStart, chunkSize);
 
-    return responseBodyBuffer;
+        *decodedLength += chunkSize;
+        *parseOffset = dataStart + chunkSize + 2;
+    }
 }
 
-void *scrapingOperations(void *path)
+void printConnectionStatistics()
 {
-    int errorCode;
-    char *scrapePath = (char *)path;
-
-    char *responseBody = makeHTTPRequest(parsedInfo->IP, parsedInfo->baseURL, scrapePath, 4096, &errorCode);
+    pthread_mutex_lock(&connectionStatisticsMutex);
 
-    if (!responseBody)
+    // Plain HTTP crawls never handshake, so the TLS line is left out for them
+    if (connectionStatistics.fullHandshakes || connectionStatistics.resumedHandshakes)
     {
-        printf("Could not get HTML for the provided URL, ");
+        printf("TLS handshakes: %ld full", connectionStatistics.fullHandshakes);
 
-        if (errorCode == 1)
-            printf("creating a socket to make the initial request!\n");
-        else if (errorCode == 2)
-            printf("connection failure!\n");
-        else if (errorCode == 3)
-            printf("connection write failure!\n");
-        else if (errorCode == 4)
-            printf("connection read failure!\n");
-        else if (errorCode == 5)
-            printf("bad response (non-200 status code)!\n");
+        if (connectionStatistics.fullHandshakes)
+            printf(" (avg %.2f ms)", connectionStatistics.fullHandshakeSeconds * 1000 / connectionStatistics.fullHandshakes);
 
-        free(responseBody);
-        freeScrapingInfo(parsedInfo);
+        printf(", %ld resumed", connectionStatistics.resumedHandshakes);
 
-        return 1;
-    }
+        if (connectionStatistics.resumedHandshakes)
+            printf(" (avg %.2f ms)", connectionStatistics.resumedHandshakeSeconds * 1000 / connectionStatistics.resumedHandshakes);
 
-    int numberOfURLsReturned = 0;
+        printf("\n");
+    }
 
-    char **URLs = getURLs(responseBody, &errorCode);
+    if (connectionStatistics.reusedConnections)
+        printf("Requests served over reused connections: %ld\n", connectionStatistics.reusedConnections);
 
-    if (URLs)
-    {
-        numberOfURLsReturned = errorCode;
+    pthread_mutex_unlock(&connectionStatisticsMutex);
+}
 
-        pthread_mutex_lock(&urlAddMutex);
+// Sends the request over the connection and reads back the response body; keepAlive is set when the
+// response was framed (Content-Length or chunked) and fully read, so the connection can be reused.
+// statusCode is 0 if no status line was received, location is only set (and must be freed) for 3xx responses.
+// Reading stops once the body reaches maxBodySize bytes, and only that much of it is returned
+char *sendHTTPRequest(HTTPConnection *connection, char *requestString, int bufferSize, int maxBodySize, int *errorCode, int *keepAlive, int *statusCode, char **location)
+{
+    // Create a buffer for holding the read data
+    char streamBuffer[bufferSize];
 
-        for (int i = 0; i < numberOfURLsReturned; i++) {
-            printf("%s\n", URLs[i]);
-            pushURLStackNode(TotalUrlStack, parsedInfo->pathURL);
-        }
+    // Create buffer for accumulating read in data to find the end of the headers
+    // and beginning of response body, and create buffer to hold the response body itself
+    char *responseHeadersBuffer = NULL, *responseBodyBuffer = NULL;
 
-        pthread_mutex_unlock(&urlAddMutex);
-    }
+    *keepAlive = 0;
+    *statusCode = 0;
+    *location = NULL;
 
-    free(responseBody);
+    int numberOfBytesWritten = connectionWrite(connection, requestString, strlen(requestString));
 
-    // Need to do proper freeing in the main thread
-    /* if (numberOfURLsReturned)
+    // If the returned number of bytes written is less than 0 an error occured
+    if (numberOfBytesWritten < 0)
     {
-        for (int i = 0; i < numberOfURLsReturned; i++)
-            free(URLs[i]);
-    }*/
+        // Indicate connection write failure with error code 3
+        *errorCode = 3;
 
-    pthread_exit(NULL);
-}
+        return NULL;
+    }
 
-int main(int argc, char **argv)
-{
-    char *endptr = NULL;
+    int responseBodyBufferLength = 0, preamble = 1, preambleBufferLength = 0;
 
-    int nThreads = (int) strtol(argv[1], &endptr, 10);
+    // contentLength stays -1 when the response is delimited by the server closing the connection
+    int contentLength = -1, chunked = 0, connectionClose = 0, complete = 0, truncated = 0;
 
-    if (argv[1] == endptr) {
-        printf("An error occured parsing the desired number of threads.\n");
+    int majorVersion = 0, minorVersion = 0;
 
-        return 1;
-    } else if (nThreads <= 0) {
-        printf("Number of desired threads must be > 0!\n");
+    // Read and write positions used to decode a chunked body in place
+    int chunkParseOffset = 0, decodedLength = 0;
 
-        return 1;
-    }
+    int numberOfBytesRead;
 
-    if (argc < 2)
+    while (!complete && (numberOfBytesRead = connectionRead(connection, streamBuffer, bufferSize)) > 0)
     {
-        printf("URL must be provided as a command line argument!\n");
-
-        return 1;
-    }
+        if (preamble)
+        {
+            preambleBufferLength += numberOfBytesRead;
 
-    int errorCode;
+            // +1 to account for NULL terminator
+            responseHeadersBuffer = realloc(responseHeadersBuffer, sizeof(char) * (preambleBufferLength + 1));
 
-    parsedInfo = getScrapingInfo(argv[2], &errorCode);
+            memcpy(responseHeadersBuffer + preambleBufferLength - numberOfBytesRead, streamBuffer, numberOfBytesRead);
+            responseHeadersBuffer[preambleBufferLength] = 0;
+
+            // Points to the memory location where the beginning of the substring "\r\n\r\n" occurs
+            char *headerEndPointer = strstr(responseHeadersBuffer, "\r\n\r\n");
+
+            // headerEndPointer will be NULL if the substring cannot be found
+            if (!headerEndPointer)
+            {
+                if (preambleBufferLength > MAX_HEADER_BYTES)
+                    break;
+
+                continue;
+            }
+
+            // Some pointer arithmatic with the found pointer to get the starting index of the substring
+            int headerEndingLength = headerEndPointer - responseHeadersBuffer;
+
+            // Need to subtract 4 more to headerEndingLength account for the '\r\n\r\n' substring
+            responseBodyBufferLength = (preambleBufferLength - headerEndingLength - 4);
+
+            // +1 to account for NULL terminator
+            responseBodyBuffer = (char *)malloc(sizeof(char) * (responseBodyBufferLength + 1));
+
+            // 4 to skip the '\r\n\r\n' substring
+            memcpy(responseBodyBuffer, (char *)headerEndPointer + 4, responseBodyBufferLength);
+
+            // Cut the headers off so the header lookups below cannot run into the body
+            headerEndPointer[2] = 0;
+
+            preamble = 0;
+
+            // Attempt to parse the version and status code, a failure leaves statusCode as 0 which is treated as a bad response
+            if (sscanf(responseHeadersBuffer, "HTTP/%d.%d %d", &majorVersion, &minorVersion, statusCode) < 3)
+                *statusCode = 0;
+
+            if (*statusCode < 200 || *statusCode > 299)
+            {
+                // Indicate bad response (non-200 status code) with error code 5
+                *errorCode = 5;
+
+                char *headerValue = findHeaderValue(responseHeadersBuffer, "Location");
+
+                if (*statusCode >= 300 && *statusCode <= 399 && headerValue)
+                    *location = strndup(headerValue, strcspn(headerValue, "\r\n"));
+
+                // Perform cleanup
+                free(responseBodyBuffer);
+                free(responseHeadersBuffer);
+
+                return NULL;
+            }
+
+            char *headerValue;
+
+            if ((headerValue = findHeaderValue(responseHeadersBuffer, "Transfer-Encoding")) && !strncasecmp(headerValue, "chunked", 7))
+                chunked = 1;
+            else if ((headerValue = findHeaderValue(responseHeadersBuffer, "Content-Length")))
+            {
+                long announcedLength = strtol(headerValue, NULL, 10);
+
+                contentLength = announcedLength > INT_MAX ? INT_MAX : (int)announcedLength;
+            }
+            else if (*statusCode == 204)
+                contentLength = 0;
+
+            // HTTP/1.1 connections persist unless the server closes them, HTTP/1.0 ones only if it asks to keep them
+            headerValue = findHeaderValue(responseHeadersBuffer, "Connection");
+
+            if (majorVersion == 1 && minorVersion == 0)
+                connectionClose = !headerValue || strncasecmp(headerValue, "keep-alive", 10);
+            else if (headerValue && !strncasecmp(headerValue, "close", 5))
+                connectionClose = 1;
+        }
+        else
+        {
+            responseBodyBufferLength += numberOfBytesRead;
+
+            responseBodyBuffer = (char *)realloc(responseBodyBuffer, sizeof(char) * (responseBodyBufferLength + 1));
+
+            memcpy(responseBodyBuffer + responseBodyBufferLength - numberOfBytesRead, streamBuffer, numberOfBytesRead);
+        }
+
+        if (chunked)
+            complete = decodeChunks(responseBodyBuffer, responseBodyBufferLength, &chunkParseOffset, &decodedLength);
+        else if (contentLength >= 0)
+            complete = responseBodyBufferLength >= contentLength;
+
+        // The rest of an oversized body is never read, so the connection cannot be reused
+        if (!complete && responseBodyBufferLength >= maxBodySize)
+        {
+            truncated = connectionClose = 1;
+
+            break;
+        }
+    }
+
+    free(responseHeadersBuffer);
+
+    // A read error, a connection closed before the headers arrived, a malformed chunked body,
+    // or a framed body which was cut short all mean the response cannot be trusted
+    if ((!complete && numberOfBytesRead < 0) || preamble || complete < 0 || (!complete && !truncated && (chunked || contentLength >= 0)))
+    {
+        // Indicate connection read failure with error code 4
+        *errorCode = 4;
+
+        // Perform cleanup
+        free(responseBodyBuffer);
+
+        return NULL;
+    }
+
+    if (chunked)
+        responseBodyBufferLength = decodedLength;
+    else if (contentLength >= 0 && responseBodyBufferLength > contentLength)
+    {
+        // The server sent more than it announced, so the connection is out of step and cannot be reused
+        responseBodyBufferLength = contentLength;
+        connectionClose = 1;
+    }
+
+    if (responseBodyBufferLength > maxBodySize)
+        responseBodyBufferLength = maxBodySize;
+
+    responseBodyBuffer[responseBodyBufferLength] = 0;
+
+    *keepAlive = complete && !connectionClose;
+    *errorCode = 0;
+
+    return responseBodyBuffer;
+}
+
+// statusCode and location are optional (may be NULL), see sendHTTPRequest
+char *makeHTTPRequest(ScrapingInfo *scrapingInfo, char *pathURL, int bufferSize, int maxBodySize, int *errorCode, int *statusCode, char **location)
+{
+    int ignoredStatusCode;
+    char *ignoredLocation = NULL;
+
+    if (!statusCode)
+        statusCode = &ignoredStatusCode;
+
+    if (!location)
+        location = &ignoredLocation;
+
+    *statusCode = 0;
+    *location = NULL;
+
+    char poolKey[strlen(scrapingInfo->baseURL) + 32];
+
+    snprintf(poolKey, sizeof(poolKey), "%s://%s:%d", scrapingInfo->useTLS ? "https" : "http", scrapingInfo->baseURL, scrapingInfo->port);
+
+    char hostHeader[strlen(scrapingInfo->baseURL) + 16];
+
+    // The port only belongs in the Host header when it is not the scheme's default
+    if (scrapingInfo->port == (scrapingInfo->useTLS ? 443 : 80))
+        snprintf(hostHeader, sizeof(hostHeader), "%s", scrapingInfo->baseURL);
+    else
+        snprintf(hostHeader, sizeof(hostHeader), "%s:%d", scrapingInfo->baseURL, scrapingInfo->port);
+
+    char *requestFormatString = "GET %s HTTP/1.1\r\nHost: %s\r\nUser-Agent: " SPIDER_USER_AGENT "\r\nConnection: keep-alive\r\n\r\n";
+
+    // Calculate length needed for the request body string,
+    // subtract 4 to account for the space taken up by format specifiers
+    int totalLength = strlen(requestFormatString) + strlen(hostHeader) + strlen(pathURL) - 4 + 1;
+
+    // Create string to hold request body, add 1 for the NULL terminator
+    char requestString[totalLength];
+
+    // Create request body
+    snprintf(requestString, totalLength, requestFormatString, pathURL, hostHeader);
+
+    HTTPConnection *connection = takeIdleConnection(poolKey);
+
+    int reusedConnection = connection != NULL, keepAlive;
+
+    if (!connection && !(connection = openConnection(scrapingInfo, poolKey, errorCode)))
+        return NULL;
+
+    char *responseBodyBuffer = sendHTTPRequest(connection, requestString, bufferSize, maxBodySize, errorCode, &keepAlive, statusCode, location);
+
+    // The server may have dropped a pooled connection while it sat idle, so a write or read
+    // failure on a reused connection gets one more try on a fresh connection
+    if (!responseBodyBuffer && reusedConnection && (*errorCode == 3 || *errorCode == 4))
+    {
+        closeConnection(connection);
+
+        reusedConnection = 0;
+
+        if (!(connection = openConnection(scrapingInfo, poolKey, errorCode)))
+            return NULL;
+
+        responseBodyBuffer = sendHTTPRequest(connection, requestString, bufferSize, maxBodySize, errorCode, &keepAlive, statusCode, location);
+    }
+
+    if (responseBodyBuffer && reusedConnection)
+    {
+        pthread_mutex_lock(&connectionStatisticsMutex);
+
+        connectionStatistics.reusedConnections++;
+
+        pthread_mutex_unlock(&connectionStatisticsMutex);
+    }
+
+    if (keepAlive)
+        releaseConnection(connection);
+    else
+        closeConnection(connection);
+
+    free(ignoredLocation);
+
+    return responseBodyBuffer;
+}
+
+// Value of a hex digit, or -1 if the character is not one
+int hexDigitValue(char digit)
+{
+    if (digit >= '0' && digit <= '9')
+        return digit - '0';
+
+    if (digit >= 'a' && digit <= 'f')
+        return digit - 'a' + 10;
+
+    if (digit >= 'A' && digit <= 'F')
+        return digit - 'A' + 10;
+
+    return -1;
+}
+
+int isUnreservedCharacter(int character)
+{
+    return (character >= 'A' && character <= 'Z') || (character >= 'a' && character <= 'z') ||
+           (character >= '0' && character <= '9') || character == '-' || character == '.' || character == '_' ||
+           character == '~';
+}
+
+// Returns a copy of a path (and query) with normalized percent-encoding (RFC 3986 section 6.2.2.2):
+// escaped unreserved characters are decoded and the hex digits of every other escape are uppercased, so
+// equivalent paths compare equal. Bytes a path or query may not contain (spaces, control characters,
+// non-ASCII, a '%' not starting an escape) are percent-encoded, since gumbo hands over links with their
+// character references decoded and they must not break the request line
+char *normalizePercentEncoding(char *text)
+{
+    // Every byte takes at most three once encoded
+    char *normalized = malloc(strlen(text) * 3 + 1), *write = normalized;
+
+    for (unsigned char *read = (unsigned char *)text; *read;)
+    {
+        int high = read[0] == '%' ? hexDigitValue(read[1]) : -1, low = high < 0 ? -1 : hexDigitValue(read[2]);
+
+        if (low >= 0)
+        {
+            int value = high * 16 + low;
+
+            if (isUnreservedCharacter(value))
+            {
+                *write++ = value;
+            }
+            else
+            {
+                *write++ = '%';
+                *write++ = "0123456789ABCDEF"[high];
+                *write++ = "0123456789ABCDEF"[low];
+            }
+
+            read += 3;
+        }
+        else if (isUnreservedCharacter(*read) || strchr("!$&'()*+,;=:@/?", *read))
+        {
+            *write++ = *read++;
+        }
+        else
+        {
+            *write++ = '%';
+            *write++ = "0123456789ABCDEF"[*read >> 4];
+            *write++ = "0123456789ABCDEF"[*read & 15];
+
+            read++;
+        }
+    }
+
+    *write = 0;
+
+    return normalized;
+}
+
+// Removes "." and ".." segments from an absolute path in place (RFC 3986 section 5.2.4); the output
+// never grows past the input, so both can share the buffer
+void removeDotSegments(char *path)
+{
+    char *input = path, *output = path;
+
+    while (*input)
+    {
+        if (!strncmp(input, "/./", 3))
+        {
+            input += 2;
+        }
+        else if (!strcmp(input, "/."))
+        {
+            // Leaves "/" as the remaining input
+            input[1] = 0;
+        }
+        else if (!strncmp(input, "/../", 4) || !strcmp(input, "/.."))
+        {
+            // Leaves the rest of the input starting with "/"
+            if (input[3])
+                input += 3;
+            else
+                (input += 2)[0] = '/';
+
+            // Drop the last segment written to the output
+            while (output > path && *--output != '/')
+                ;
+        }
+        else
+        {
+            // Move the first segment, with its leading '/', to the output
+            do
+                *output++ = *input++;
+            while (*input && *input != '/');
+        }
+    }
+
+    *output = 0;
+}
+
+// Resolves a link against the path (and query) of the page it was found on following RFC 3986
+// section 5.2, returning the normalized "path?query" to request without any fragment
+char *resolveReferencePath(char *basePath, char *reference)
+{
+    int referenceLength = strcspn(reference, "#"), referencePathLength = strcspn(reference, "?#");
+    int basePathLength = strcspn(basePath, "?#"), baseLength = strcspn(basePath, "#");
+
+    // The result is at most the base and reference put together
+    char *resolved = malloc(baseLength + referenceLength + 2), *end = resolved;
+
+    if (!referencePathLength)
+    {
+        // An empty path keeps the current page, along with its query unless the reference has its own
+        memcpy(end, basePath, basePathLength);
+        end += basePathLength;
+
+        if (reference[0] == '?')
+        {
+            memcpy(end, reference, referenceLength);
+            end += referenceLength;
+        }
+        else
+        {
+            memcpy(end, basePath + basePathLength, baseLength - basePathLength);
+            end += baseLength - basePathLength;
+        }
+    }
+    else
+    {
+        // Relative paths are merged with everything up to the last '/' of the current path
+        if (reference[0] != '/')
+        {
+            int directoryLength = basePathLength;
+
+            while (directoryLength && basePath[directoryLength - 1] != '/')
+                directoryLength--;
+
+            if (directoryLength)
+            {
+                memcpy(end, basePath, directoryLength);
+                end += directoryLength;
+            }
+            else
+            {
+                *end++ = '/';
+            }
+        }
+
+        memcpy(end, reference, referenceLength);
+        end += referenceLength;
+    }
+
+    *end = 0;
+
+    // Percent-encoding is normalized first so escaped dots (%2E) are removed as dot segments too
+    char *merged = resolved;
+
+    resolved = normalizePercentEncoding(merged);
+
+    free(merged);
+
+    char *query = strdup(resolved + strcspn(resolved, "?"));
+
+    resolved[strcspn(resolved, "?")] = 0;
+
+    removeDotSegments(resolved);
+    strcat(resolved, query);
+
+    free(query);
+
+    return resolved;
+}
+
+// Turns a link found on the page at currentPath into a normalized path on the host being crawled,
+// returns NULL for links to other hosts, other schemes, and in-page anchors
+char *getCrawlPath(ScrapingInfo *scrapingInfo, char *currentPath, char *URL)
+{
+    char *scheme = scrapingInfo->useTLS ? "https://" : "http://";
+
+    int schemeLength = strlen(scheme), hostLength = strlen(scrapingInfo->baseURL);
+
+    if (!strncasecmp(URL, scheme, schemeLength) || !strncmp(URL, "//", 2))
+    {
+        char *host = URL + (URL[0] == '/' ? 2 : schemeLength);
+
+        if (strncasecmp(host, scrapingInfo->baseURL, hostLength))
+            return NULL;
+
+        char *rest = host + hostLength;
+
+        // An explicit port has to be the one being crawled
+        if (*rest == ':')
+        {
+            char *portEnd;
+
+            if (strtol(rest + 1, &portEnd, 10) != scrapingInfo->port)
+                return NULL;
+
+            rest = portEnd;
+        }
+
+        if (*rest && *rest != '/' && *rest != '?' && *rest != '#')
+            return NULL;
+
+        if (*rest == '/')
+            return resolveReferencePath(currentPath, rest);
+
+        // An empty path after the host is the root
+        char absoluteReference[strlen(rest) + 2];
+
+        sprintf(absoluteReference, "/%s", rest);
+
+        return resolveReferencePath(currentPath, absoluteReference);
+    }
+
+    // Links to the page itself, and anything with a ':' before the first '/', '?' or '#' (another
+    // scheme such as mailto:) are not crawled
+    if (!URL[0] || URL[0] == '#' || strcspn(URL, ":") < strcspn(URL, "/?#"))
+        return NULL;
+
+    return resolveReferencePath(currentPath, URL);
+}
+
+int addRobotsTrieNode(RobotsMatcher *matcher, unsigned char label)
+{
+    if (matcher->nodeCount == matcher->nodeCapacity)
+    {
+        matcher->nodeCapacity = matcher->nodeCapacity ? matcher->nodeCapacity * 2 : 16;
+        matcher->nodes = realloc(matcher->nodes, sizeof(robotsTrieNode) * matcher->nodeCapacity);
+    }
+
+    robotsTrieNode *node = &matcher->nodes[matcher->nodeCount];
+
+    node->firstChild = -1;
+    node->nextSibling = -1;
+    node->depth = 0;
+    node->label = label;
+    node->rule = 0;
+    node->endRule = 0;
+
+    return matcher->nodeCount++;
+}
+
+void initializeRobotsMatcher(RobotsMatcher *matcher)
+{
+    matcher->nodes = NULL;
+    matcher->nodeCount = 0;
+    matcher->nodeCapacity = 0;
+
+    // Node 0 is the root, a rule on it matches every path
+    addRobotsTrieNode(matcher, 0);
+}
+
+// Inserts an Allow (allow = 1) or Disallow (allow = 0) pattern into the trie
+void addRobotsRule(RobotsMatcher *matcher, char *pattern, int allow)
+{
+    int patternLength = strlen(pattern), anchored = 0, nodeIndex = 0;
+
+    // A trailing '$' anchors the pattern to the end of the path
+    if (patternLength && pattern[patternLength - 1] == '$')
+    {
+        anchored = 1;
+        patternLength--;
+    }
+
+    // Rules are prefix matches already, so trailing wildcards add nothing
+    while (!anchored && patternLength && pattern[patternLength - 1] == '*')
+        patternLength--;
+
+    if (patternLength > ROBOTS_MAX_RULE_LENGTH)
+        return;
+
+    for (int i = 0; i < patternLength; i++)
+    {
+        // Runs of wildcards behave like a single one
+        if (pattern[i] == '*' && i && pattern[i - 1] == '*')
+            continue;
+
+        int child = matcher->nodes[nodeIndex].firstChild;
+
+        while (child != -1 && matcher->nodes[child].label != (unsigned char)pattern[i])
+            child = matcher->nodes[child].nextSibling;
+
+        if (child == -1)
+        {
+            child = addRobotsTrieNode(matcher, pattern[i]);
+
+            matcher->nodes[child].depth = matcher->nodes[nodeIndex].depth + 1;
+            matcher->nodes[child].nextSibling = matcher->nodes[nodeIndex].firstChild;
+            matcher->nodes[nodeIndex].firstChild = child;
+        }
+
+        nodeIndex = child;
+    }
+
+    signed char *rule = anchored ? &matcher->nodes[nodeIndex].endRule : &matcher->nodes[nodeIndex].rule;
+
+    // When the same pattern is both allowed and disallowed, Allow wins
+    if (*rule != 1)
+        *rule = allow ? 1 : -1;
+}
+
+void freeRobotsMatchScratch(void *scratchPointer)
+{
+    RobotsMatchScratch *scratch = scratchPointer;
+
+    free(scratch->liveNodes);
+    free(scratch->nextNodes);
+    free(scratch->nodeSteps);
+    free(scratch);
+}
+
+void createRobotsScratchKey()
+{
+    pthread_key_create(&robotsScratchKey, freeRobotsMatchScratch);
+}
+
+// Returns the calling thread's scratch space, grown to fit nodeCount nodes. It is kept across checks
+// so they do not allocate, and freed when the thread exits
+RobotsMatchScratch *getRobotsMatchScratch(int nodeCount)
+{
+    RobotsMatchScratch *scratch = robotsScratch;
+
+    if (!scratch)
+    {
+        pthread_once(&robotsScratchKeyOnce, createRobotsScratchKey);
+
+        robotsScratch = scratch = calloc(1, sizeof(RobotsMatchScratch));
+
+        pthread_setspecific(robotsScratchKey, scratch);
+    }
+
+    if (scratch->capacity < nodeCount)
+    {
+        scratch->capacity = nodeCount;
+
+        scratch->liveNodes = realloc(scratch->liveNodes, sizeof(int) * scratch->capacity);
+        scratch->nextNodes = realloc(scratch->nextNodes, sizeof(int) * scratch->capacity);
+
+        // Steps only ever increase, so zeroed entries never look like they belong to the current one
+        free(scratch->nodeSteps);
+        scratch->nodeSteps = calloc(scratch->capacity, sizeof(unsigned long));
+    }
+
+    return scratch;
+}
+
+// Adds a node to the list of live nodes being built for the current scratch step, along with its
+// wildcard children since a wildcard can also match nothing
+void addLiveRobotsNode(RobotsMatcher *matcher, RobotsMatchScratch *scratch, int nodeIndex, int *liveNodes, int *liveCount)
+{
+    if (scratch->nodeSteps[nodeIndex] == scratch->step)
+        return;
+
+    scratch->nodeSteps[nodeIndex] = scratch->step;
+    liveNodes[(*liveCount)++] = nodeIndex;
+
+    for (int child = matcher->nodes[nodeIndex].firstChild; child != -1; child = matcher->nodes[child].nextSibling)
+        if (matcher->nodes[child].label == '*')
+            addLiveRobotsNode(matcher, scratch, child, liveNodes, liveCount);
+}
+
+// Returns 1 if the rules allow the path, 0 if they disallow it. The trie is run like an NFA: after
+// each path character the set of nodes whose pattern matches so far is kept, each node at most once,
+// so a check costs at most path length * node count steps however many wildcards the rules have.
+// Of all matching rules the one with the longest pattern (the most specific) wins, Allow winning ties
+int matchRobotsRules(RobotsMatcher *matcher, char *path)
+{
+    RobotsMatchScratch *scratch = getRobotsMatchScratch(matcher->nodeCount);
+    int *liveNodes = scratch->liveNodes, *nextNodes = scratch->nextNodes;
+
+    // Paths without a matching rule are allowed
+    int liveCount = 0, nextCount, bestLength = -1, bestRule = 1;
+
+    scratch->step++;
+
+    addLiveRobotsNode(matcher, scratch, 0, liveNodes, &liveCount);
+
+    for (char *character = path; liveCount; character++)
+    {
+        for (int i = 0; i < liveCount; i++)
+        {
+            robotsTrieNode *node = &matcher->nodes[liveNodes[i]];
+
+            // Plain rules match any path starting with the pattern, '$' rules only the whole path
+            int rule = node->rule;
+
+            if (!*character && node->endRule && (!rule || node->endRule == 1))
+                rule = node->endRule;
+
+            if (rule && (node->depth > bestLength || (node->depth == bestLength && rule == 1)))
+            {
+                bestLength = node->depth;
+                bestRule = rule;
+            }
+        }
+
+        if (!*character)
+            break;
+
+        scratch->step++;
+        nextCount = 0;
+
+        for (int i = 0; i < liveCount; i++)
+        {
+            int nodeIndex = liveNodes[i];
+
+            // A wildcard stays live while it swallows characters
+            if (nodeIndex && matcher->nodes[nodeIndex].label == '*')
+                addLiveRobotsNode(matcher, scratch, nodeIndex, nextNodes, &nextCount);
+
+            for (int child = matcher->nodes[nodeIndex].firstChild; child != -1; child = matcher->nodes[child].nextSibling)
+                if (matcher->nodes[child].label == (unsigned char)*character)
+                    addLiveRobotsNode(matcher, scratch, child, nextNodes, &nextCount);
+        }
+
+        int *swap = liveNodes;
+
+        liveNodes = nextNodes;
+        nextNodes = swap;
+        liveCount = nextCount;
+    }
+
+    return bestRule == 1;
+}
+
+// Compiles the rules of the robots.txt groups that apply to ROBOTS_USER_AGENT into the matcher; the
+// groups naming us take precedence over the '*' groups, which are only used when none name us
+void compileRobotsRules(char *robotsText, RobotsMatcher *matcher, double *crawlDelaySeconds)
+{
+    RobotsMatcher wildcardMatcher;
+    double wildcardCrawlDelay = 0;
+
+    // Whether the current group names us or '*', and whether any group named us at all
+    int groupMatchesUs = 0, groupMatchesWildcard = 0, namedGroupFound = 0, previousLineWasAgent = 0;
+
+    initializeRobotsMatcher(&wildcardMatcher);
+
+    *crawlDelaySeconds = 0;
+
+    if (strlen(robotsText) > ROBOTS_MAX_BYTES)
+        robotsText[ROBOTS_MAX_BYTES] = 0;
+
+    char *savePointer, *line = strtok_r(robotsText, "\r\n", &savePointer);
+
+    for (; line; line = strtok_r(NULL, "\r\n", &savePointer))
+    {
+        char *comment = strchr(line, '#');
+
+        if (comment)
+            *comment = 0;
+
+        char *value = strchr(line, ':');
+
+        if (!value)
+            continue;
+
+        char *keyEnd = value;
+
+        // Trim the key and value
+        while (keyEnd > line && (keyEnd[-1] == ' ' || keyEnd[-1] == '\t'))
+            keyEnd--;
+
+        *keyEnd = 0;
+        value++;
+
+        while (*value == ' ' || *value == '\t')
+            value++;
+
+        char *valueEnd = value + strlen(value);
+
+        while (valueEnd > value && (valueEnd[-1] == ' ' || valueEnd[-1] == '\t'))
+            valueEnd--;
+
+        *valueEnd = 0;
+
+        while (*line == ' ' || *line == '\t')
+            line++;
+
+        if (!strcasecmp(line, "user-agent"))
+        {
+            // Consecutive User-agent lines share one group, any other line ends the list
+            if (!previousLineWasAgent)
+                groupMatchesUs = groupMatchesWildcard = 0;
+
+            // Only the product token is compared, so "CThreadedWebSpider/1.0" still names us
+            int tokenLength = strcspn(value, "/ \t");
+
+            if (tokenLength == 1 && *value == '*')
+                groupMatchesWildcard = 1;
+            else if (tokenLength == strlen(ROBOTS_USER_AGENT) && !strncasecmp(value, ROBOTS_USER_AGENT, tokenLength))
+                groupMatchesUs = namedGroupFound = 1;
+
+            previousLineWasAgent = 1;
+
+            continue;
+        }
+
+        previousLineWasAgent = 0;
+
+        int allow = !strcasecmp(line, "allow");
+
+        if (allow || !strcasecmp(line, "disallow"))
+        {
+            // An empty Disallow allows everything, which is already the default
+            if (!*value)
+                continue;
+
+            // Compared against paths normalized by getCrawlPath, so normalize the pattern the same way
+            char *pattern = normalizePercentEncoding(value);
+
+            if (groupMatchesUs)
+                addRobotsRule(matcher, pattern, allow);
+
+            if (groupMatchesWildcard)
+                addRobotsRule(&wildcardMatcher, pattern, allow);
+
+            free(pattern);
+        }
+        else if (!strcasecmp(line, "crawl-delay"))
+        {
+            char *delayEnd;
+            double delay = strtod(value, &delayEnd);
+
+            // Values that are not a number (or are "nan"/"inf") are ignored rather than guessed at
+            if (delayEnd == value || !isfinite(delay))
+                continue;
+
+            if (delay < 0)
+                delay = 0;
+            else if (delay > ROBOTS_MAX_CRAWL_DELAY_SECONDS)
+                delay = ROBOTS_MAX_CRAWL_DELAY_SECONDS;
+
+            if (groupMatchesUs)
+                *crawlDelaySeconds = delay;
+
+            if (groupMatchesWildcard)
+                wildcardCrawlDelay = delay;
+        }
+    }
+
+    if (namedGroupFound)
+    {
+        free(wildcardMatcher.nodes);
+
+        return;
+    }
+
+    free(matcher->nodes);
+
+    *matcher = wildcardMatcher;
+    *crawlDelaySeconds = wildcardCrawlDelay;
+}
+
+// Fetches the host's robots.txt, following redirects (also to other hosts); returns NULL if there
+// was no 2xx response, with statusCode set to the last status received (0 if there was none)
+char *fetchRobotsText(ScrapingInfo *scrapingInfo, int *statusCode)
+{
+    ScrapingInfo *target = scrapingInfo;
+
+    int errorCode, redirects = 0;
+    char *location, *robotsPath = strdup("/robots.txt");
+
+    char *robotsText = makeHTTPRequest(target, robotsPath, 4096, ROBOTS_MAX_BYTES, &errorCode, statusCode, &location);
+
+    while (!robotsText && location && redirects++ < ROBOTS_MAX_REDIRECTS)
+    {
+        // Redirects within the same scheme, host and port only need the new path
+        char *redirectPath = getCrawlPath(target, robotsPath, location);
+
+        if (!redirectPath)
+        {
+            if (strncasecmp(location, "http://", 7) && strncasecmp(location, "https://", 8))
+                break;
+
+            pthread_mutex_lock(&hostLookupMutex);
+
+            ScrapingInfo *redirectTarget = getScrapingInfo(location, &errorCode);
+
+            pthread_mutex_unlock(&hostLookupMutex);
+
+            if (!redirectTarget)
+                break;
+
+            if (target != scrapingInfo)
+                freeScrapingInfo(target);
+
+            target = redirectTarget;
+            redirectPath = resolveReferencePath("/", target->pathURL);
+        }
+
+        free(robotsPath);
+        free(location);
+
+        robotsPath = redirectPath;
+        robotsText = makeHTTPRequest(target, robotsPath, 4096, ROBOTS_MAX_BYTES, &errorCode, statusCode, &location);
+    }
+
+    free(location);
+    free(robotsPath);
+
+    if (target != scrapingInfo)
+        freeScrapingInfo(target);
+
+    return robotsText;
+}
+
+// Returns the host's robots.txt entry, fetching (or refreshing) it first when needed; concurrent
+// callers for the same host wait for a single fetch, or keep using expired rules while it refreshes
+robotsCacheNode *getRobotsRules(ScrapingInfo *scrapingInfo)
+{
+    robotsCacheNode *node = __atomic_load_n(&scrapingInfo->robots, __ATOMIC_ACQUIRE);
+
+    // Fast path for every URL check: the entry is known and its rules have not expired
+    if (node && monotonicNanoseconds() < __atomic_load_n(&node->expiresAt, __ATOMIC_ACQUIRE))
+        return node;
+
+    pthread_mutex_lock(&robotsCacheMutex);
+
+    if (!node)
+    {
+        char hostKey[strlen(scrapingInfo->baseURL) + 32];
+
+        snprintf(hostKey, sizeof(hostKey), "%s://%s:%d", scrapingInfo->useTLS ? "https" : "http", scrapingInfo->baseURL, scrapingInfo->port);
+
+        node = robotsCache;
+
+        while (node && strcmp(node->hostKey, hostKey))
+            node = node->next;
+
+        if (!node)
+        {
+            node = malloc(sizeof(robotsCacheNode));
+
+            node->hostKey = strdup(hostKey);
+            node->expiresAt = 0;
+            node->ready = 0;
+            node->fetching = 0;
+            node->crawlDelaySeconds = 0;
+            node->crawlSlotsStarted = 0;
+
+            initializeRobotsMatcher(&node->matcher);
+
+            pthread_rwlock_init(&node->matcherLock, NULL);
+            pthread_cond_init(&node->fetchDone, NULL);
+            pthread_mutex_init(&node->crawlSlotMutex, NULL);
+
+            node->next = robotsCache;
+            robotsCache = node;
+        }
+
+        __atomic_store_n(&scrapingInfo->robots, node, __ATOMIC_RELEASE);
+    }
+
+    while (node->fetching && !node->ready)
+        pthread_cond_wait(&node->fetchDone, &robotsCacheMutex);
+
+    if (node->fetching || (node->ready && monotonicNanoseconds() < node->expiresAt))
+    {
+        pthread_mutex_unlock(&robotsCacheMutex);
+
+        return node;
+    }
+
+    node->fetching = 1;
+
+    pthread_mutex_unlock(&robotsCacheMutex);
+
+    int statusCode;
+    double crawlDelaySeconds = 0, ttlSeconds = ROBOTS_CACHE_TTL_SECONDS;
+
+    RobotsMatcher matcher;
+
+    initializeRobotsMatcher(&matcher);
+
+    char *robotsText = fetchRobotsText(scrapingInfo, &statusCode);
+
+    // Following RFC 9309, a 4xx (or a redirect that could not be followed) means there is no
+    // robots.txt and everything is allowed, while a server error or an unreachable server means
+    // nothing is allowed until a retry shortly after
+    if (robotsText)
+    {
+        compileRobotsRules(robotsText, &matcher, &crawlDelaySeconds);
+    }
+    else if (statusCode < 300 || statusCode > 499)
+    {
+        // A Disallow rule on the root matches every path
+        matcher.nodes[0].rule = -1;
+
+        ttlSeconds = ROBOTS_RETRY_SECONDS;
+    }
+
+    free(robotsText);
+
+    // Swap the new rules in, readers in robotsAllowed hold the read lock while matching
+    pthread_rwlock_wrlock(&node->matcherLock);
+
+    RobotsMatcher oldMatcher = node->matcher;
+
+    node->matcher = matcher;
+
+    pthread_rwlock_unlock(&node->matcherLock);
+
+    free(oldMatcher.nodes);
+
+    pthread_mutex_lock(&node->crawlSlotMutex);
+
+    node->crawlDelaySeconds = crawlDelaySeconds;
+
+    pthread_mutex_unlock(&node->crawlSlotMutex);
+
+    pthread_mutex_lock(&robotsCacheMutex);
+
+    __atomic_store_n(&node->expiresAt, monotonicNanoseconds() + (long)(ttlSeconds * 1e9), __ATOMIC_RELEASE);
+
+    node->ready = 1;
+    node->fetching = 0;
+
+    pthread_cond_broadcast(&node->fetchDone);
+
+    pthread_mutex_unlock(&robotsCacheMutex);
+
+    return node;
+}
+
+// Returns 1 if robots.txt lets us crawl the path on the host, 0 if it is disallowed
+int robotsAllowed(ScrapingInfo *scrapingInfo, char *path)
+{
+    if (strnlen(path, ROBOTS_MAX_PATH_LENGTH + 1) > ROBOTS_MAX_PATH_LENGTH)
+        return 0;
+
+    robotsCacheNode *node = getRobotsRules(scrapingInfo);
+
+    pthread_rwlock_rdlock(&node->matcherLock);
+
+    int allowed = matchRobotsRules(&node->matcher, path);
+
+    pthread_rwlock_unlock(&node->matcherLock);
+
+    return allowed;
+}
+
+// Blocks until the host's Crawl-delay since the previously scheduled request has passed; each
+// caller reserves the next slot so concurrent threads are spaced out rather than released together
+void waitForCrawlSlot(ScrapingInfo *scrapingInfo)
+{
+    robotsCacheNode *node = getRobotsRules(scrapingInfo);
+
+    struct timespec now, slot;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    pthread_mutex_lock(&node->crawlSlotMutex);
+
+    // Also rejects NaN, so the conversion to nanoseconds below is always defined
+    if (!(node->crawlDelaySeconds > 0))
+    {
+        pthread_mutex_unlock(&node->crawlSlotMutex);
+
+        return;
+    }
+
+    // The first request to a host, or one after a long pause, can go right away
+    if (node->crawlSlotsStarted && secondsSince(&node->nextCrawlSlot) < 0)
+        slot = node->nextCrawlSlot;
+    else
+        slot = now;
+
+    double delaySeconds = node->crawlDelaySeconds;
+
+    if (delaySeconds > ROBOTS_MAX_CRAWL_DELAY_SECONDS)
+        delaySeconds = ROBOTS_MAX_CRAWL_DELAY_SECONDS;
+
+    long delayNanoseconds = (long)(delaySeconds * 1e9);
+
+    node->nextCrawlSlot.tv_sec = slot.tv_sec + delayNanoseconds / 1000000000;
+    node->nextCrawlSlot.tv_nsec = slot.tv_nsec + delayNanoseconds % 1000000000;
+
+    if (node->nextCrawlSlot.tv_nsec >= 1000000000)
+    {
+        node->nextCrawlSlot.tv_sec++;
+        node->nextCrawlSlot.tv_nsec -= 1000000000;
+    }
+
+    node->crawlSlotsStarted = 1;
+
+    pthread_mutex_unlock(&node->crawlSlotMutex);
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &slot, NULL) == EINTR)
+        ;
+}
+
+// FNV-1a, computed before taking urlAddMutex to keep the critical section short
+unsigned long hashPath(char *path)
+{
+    unsigned long hash = 14695981039346656037UL;
+
+    for (; *path; path++)
+        hash = (hash ^ (unsigned char)*path) * 1099511628211UL;
+
+    return hash;
+}
+
+// Adds the path to the set unless it is already there, returning 1 if it was added; the set keeps
+// the pointer, so the caller must not free it afterwards. Must hold urlAddMutex
+int addPathToSet(PathSet *set, char *path, unsigned long hash)
+{
+    // Keep the load factor at or below one half so probe runs stay short
+    if ((set->count + 1) * 2 > set->capacity)
+    {
+        PathSet grown = {calloc(set->capacity ? set->capacity * 2 : 256, sizeof(pathSetSlot)), set->capacity ? set->capacity * 2 : 256, set->count};
+
+        for (int i = 0; i < set->capacity; i++)
+        {
+            if (!set->slots[i].path)
+                continue;
+
+            int index = set->slots[i].hash & (grown.capacity - 1);
+
+            while (grown.slots[index].path)
+                index = (index + 1) & (grown.capacity - 1);
+
+            grown.slots[index] = set->slots[i];
+        }
+
+        free(set->slots);
+
+        *set = grown;
+    }
+
+    int index = hash & (set->capacity - 1);
+
+    for (; set->slots[index].path; index = (index + 1) & (set->capacity - 1))
+        if (set->slots[index].hash == hash && !strcmp(set->slots[index].path, path))
+            return 0;
+
+    set->slots[index].path = path;
+    set->slots[index].hash = hash;
+    set->count++;
+
+    return 1;
+}
+
+void *scrapingOperations(void *path)
+{
+    int errorCode;
+    char *scrapePath = (char *)path, *crawlPath;
+
+    // Honor the host's Crawl-delay
+    waitForCrawlSlot(parsedInfo);
+
+    char *responseBody = makeHTTPRequest(parsedInfo, scrapePath, 4096, MAX_PAGE_BYTES, &errorCode, NULL, NULL);
+
+    if (!responseBody)
+    {
+        printf("Could not get HTML for the provided URL, ");
+
+        if (errorCode == 1)
+            printf("creating a socket to make the initial request!\n");
+        else if (errorCode == 2)
+            printf("connection failure!\n");
+        else if (errorCode == 3)
+            printf("connection write failure!\n");
+        else if (errorCode == 4)
+            printf("connection read failure!\n");
+        else if (errorCode == 5)
+            printf("bad response (non-200 status code)!\n");
+        else if (errorCode == 6)
+            printf("TLS setup failure!\n");
+        else if (errorCode == 7)
+            printf("TLS handshake failure!\n");
+
+        // parsedInfo is shared with the other threads, so it is left for main
+        return NULL;
+    }
+
+    int numberOfURLsReturned = 0;
+
+    char **URLs = getURLs(responseBody, &errorCode);
+
+    if (URLs)
+    {
+        numberOfURLsReturned = errorCode;
+
+        for (int i = 0; i < numberOfURLsReturned; i++) {
+            printf("%s\n", URLs[i]);
+
+            crawlPath = getCrawlPath(parsedInfo, scrapePath, URLs[i]);
+
+            // Paths are checked against robots.txt before they can enter the frontier
+            if (crawlPath && robotsAllowed(parsedInfo, crawlPath))
+            {
+                unsigned long crawlPathHash = hashPath(crawlPath);
+
+                pthread_mutex_lock(&urlAddMutex);
+
+                if (addPathToSet(&queuedPaths, crawlPath, crawlPathHash))
+                {
+                    pushURLStackNode(&TotalUrlStack, crawlPath);
+
+                    crawlPath = NULL;
+                }
+
+                pthread_mutex_unlock(&urlAddMutex);
+            }
+
+            free(crawlPath);
+            free(URLs[i]);
+        }
+
+        free(URLs);
+    }
+
+    free(responseBody);
+
+    pthread_exit(NULL);
+}
+
+int main(int argc, char **argv)
+{
+    char *endptr = NULL;
+
+    if (argc < 3)
+    {
+        printf("URL must be provided as a command line argument!\n");
+
+        return 1;
+    }
+
+    int nThreads = (int) strtol(argv[1], &endptr, 10);
+
+    if (argv[1] == endptr) {
+        printf("An error occured parsing the desired number of threads.\n");
+
+        return 1;
+    } else if (nThreads <= 0) {
+        printf("Number of desired threads must be > 0!\n");
+
+        return 1;
+    }
+
+    // Optional third argument: PEM file of CA certificates to trust instead of the system store
+    if (argc > 3)
+        tlsCAFile = argv[3];
+
+    int errorCode;
+
+    parsedInfo = getScrapingInfo(argv[2], &errorCode);
 
     // If NULL is returned an error occured
     if (!parsedInfo)
@@ -675,22 +2223,39 @@ int main(int argc, char **argv)
 
     pthread_t threads[nThreads];
 
-    pushURLStackNode(TotalUrlStack, parsedInfo->pathURL);
+    // Normalize the starting path the same way as discovered links, for robots.txt and the frontier
+    char *seedPath = resolveReferencePath("/", parsedInfo->pathURL);
+
+    free(parsedInfo->pathURL);
+
+    parsedInfo->pathURL = seedPath;
+
+    if (!robotsAllowed(parsedInfo, parsedInfo->pathURL))
+    {
+        printf("robots.txt does not allow crawling %s, or could not be fetched!\n", parsedInfo->pathURL);
+
+        return 1;
+    }
+
+    pushURLStackNode(&TotalUrlStack, parsedInfo->pathURL);
+    addPathToSet(&queuedPaths, parsedInfo->pathURL, hashPath(parsedInfo->pathURL));
 
     while (TotalUrlStack)
     {
         for (threadCounter = 0; threadCounter < nThreads && TotalUrlStack; threadCounter++)
         {
-            pathPointer = popURLStackNode(TotalUrlStack);
+            pathPointer = popURLStackNode(&TotalUrlStack);
 
             pthread_create(&threads[threadCounter], NULL, scrapingOperations, (void *)pathPointer);
         }
 
-        for (joinCounter = 0; threadCounter < threadCounter; threadCounter++)
+        for (joinCounter = 0; joinCounter < threadCounter; joinCounter++)
         {
-            pthread_join(&threads[threadCounter], NULL);
+            pthread_join(threads[joinCounter], NULL);
         }
     }
 
+    printConnectionStatistics();
+
     return 0;
 }
\ No newline at end of file